@@ -58,6 +58,7 @@
 
 // enables implementations of collections
 #ifdef BNP_COLLECTION_IMPLEMENTATION
+  #define BNPC_CACHE_IMPLEMENTATION   // completed (deps: hashmap, list)
   #define BNPC_HASHMAP_IMPLEMENTATION // completed
   #define BNPC_LIST_IMPLEMENTATION    // started
   #define BNPC_QUEUE_IMPLEMENTATION   // unneeded (deps: vector)
@@ -67,6 +68,7 @@
 
 // enables debugging for collections
 #ifdef BNP_COLLECTION_DEBUG
+  #define BNPC_CACHE_DEBUG   // completed
   #define BNPC_HASHMAP_DEBUG // unneeded (deps: list, vector)
   #define BNPC_LIST_DEBUG    // started
   #define BNPC_QUEUE_DEBUG   // unneeded (deps: vector)
@@ -74,6 +76,18 @@
   #define BNPC_VECTOR_DEBUG  // completed
 #endif
 
+// enables implementations of spatial structures
+#ifdef BNP_SPATIAL_IMPLEMENTATION
+  #define BNPS_GRID_IMPLEMENTATION // completed (deps: vector)
+  #define BNPS_TREE_IMPLEMENTATION // completed (deps: vector)
+#endif
+
+// enables debugging for spatial structures
+#ifdef BNP_SPATIAL_DEBUG
+  #define BNPS_GRID_DEBUG // completed
+  #define BNPS_TREE_DEBUG // completed
+#endif
+
 // force-inline
 #define BNP_FORCE_INLINE __attribute__ ((always_inline)) inline
 
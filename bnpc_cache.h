@@ -0,0 +1,225 @@
+#ifndef BNPC_CACHE_H
+#define BNPC_CACHE_H
+
+#include "bnp_common.h"
+#include "bnpc_hashmap.h"
+#include "bnpc_list.h"
+
+// eviction policies
+#define BNPC_CACHE_LRU   0 // evicts the least recently used entry
+#define BNPC_CACHE_CLOCK 1 // evicts the oldest entry not used since its last pass
+
+struct bnpc_cache_entry {
+  bnp_size charge; // share of the capacity
+  bnp_int32 referenced; // used since the last pass (clock)
+};
+
+struct bnpc_cache {
+  struct bnpc_hashmap entries; // key -> list node
+  struct bnpc_list order; // entries; the front is the newest
+  bnp_size k_size; // key size
+  bnp_size v_size; // value size
+  bnp_size capacity; // maximum usage
+  bnp_size usage; // sum of the charges
+  bnp_int32 mode; // eviction policy
+  void (*func_evict)(void* key, void* value); // eviction function (optional)
+};
+
+void      bnpc_cache_init   (struct bnpc_cache* cache, bnp_size k_size, bnp_size v_size, bnp_size reserved, bnp_size capacity, bnp_int32 mode, bnp_size (*func_hash)(void* key), bnp_int32 (*func_comp)(void* key_a, void* key_b), void (*func_evict)(void* key, void* value));
+void      bnpc_cache_free   (struct bnpc_cache* cache);
+void*     bnpc_cache_getp   (struct bnpc_cache* cache, void* key);
+bnp_int32 bnpc_cache_put    (struct bnpc_cache* cache, void* key, void* value, bnp_size charge);
+bnp_int32 bnpc_cache_remove (struct bnpc_cache* cache, void* key, void* value);
+bnp_int32 bnpc_cache_erase  (struct bnpc_cache* cache, void* key);
+bnp_int32 bnpc_cache_evict  (struct bnpc_cache* cache);
+
+#ifdef BNPC_CACHE_IMPLEMENTATION
+  #include <assert.h>
+  #include <string.h>
+
+  // Each list element holds the entry's bookkeeping followed by its key and
+  // value; the hashmap maps the key to the list node, so a hit reaches the
+  // node without searching the list.
+  #define BNPC_CACHE_KEY_OFFSET(C)   sizeof(struct bnpc_cache_entry)
+  #define BNPC_CACHE_VAL_OFFSET(C)   sizeof(struct bnpc_cache_entry) + C->k_size
+  #define BNPC_CACHE_ELEMENT_SIZE(C) sizeof(struct bnpc_cache_entry) + C->k_size + C->v_size
+
+  static struct bnpc_node* bnpc_cache__find(struct bnpc_cache* cache, void* key) {
+    // The hashmap packs values directly after keys, so the node pointer
+    // may be misaligned; it is copied out rather than dereferenced.
+    struct bnpc_node* node = NULL;
+    void* value = bnpc_hashmap_getp(&cache->entries, key);
+    if (value) {
+      memcpy(&node, value, sizeof node);
+    }
+    return node;
+  }
+
+  static void bnpc_cache__touch(struct bnpc_cache* cache, struct bnpc_node* node) {
+    // LRU keeps the list in recency order, which costs a relink on every
+    // hit. CLOCK only marks the entry; the list is reordered lazily, when
+    // an eviction passes over the entry.
+    if (cache->mode == BNPC_CACHE_LRU) {
+      bnpc_list_move(&cache->order, node);
+    } else {
+      ((struct bnpc_cache_entry*)node->elem)->referenced = 1;
+    }
+  }
+
+  static void bnpc_cache__drop(struct bnpc_cache* cache, struct bnpc_node* node) {
+    // removes the entry from both the hashmap and the list
+    struct bnpc_cache_entry* entry = (struct bnpc_cache_entry*)node->elem;
+    cache->usage -= entry->charge;
+    bnpc_hashmap_erase(&cache->entries, node->elem + BNPC_CACHE_KEY_OFFSET(cache));
+    bnpc_list_erase(&cache->order, node);
+  }
+
+  void bnpc_cache_init(
+    struct bnpc_cache* cache,
+    bnp_size k_size,
+    bnp_size v_size,
+    bnp_size reserved,
+    bnp_size capacity,
+    bnp_int32 mode,
+    bnp_size  (*func_hash)(void* key),
+    bnp_int32 (*func_comp)(void* key_a, void* key_b),
+    void (*func_evict)(void* key, void* value)) {
+    #ifdef BNPC_CACHE_DEBUG
+      assert(mode == BNPC_CACHE_LRU || mode == BNPC_CACHE_CLOCK);
+    #endif
+    cache->k_size = k_size; // key size
+    cache->v_size = v_size; // value size
+    cache->capacity = capacity; // maximum usage
+    cache->usage = 0; // no entries
+    cache->mode = mode; // eviction policy
+    cache->func_evict = func_evict; // eviction function
+    // initializes the entries
+    bnpc_hashmap_init(&cache->entries, k_size, sizeof(struct bnpc_node*), reserved, func_hash, func_comp);
+    bnpc_list_init(&cache->order, BNPC_CACHE_ELEMENT_SIZE(cache));
+  }
+
+  void bnpc_cache_free(struct bnpc_cache* cache) {
+    // The entries are still owned by the cache; the eviction function is
+    // given the chance to release them.
+    if (cache->func_evict) {
+      struct bnpc_node* beg = cache->order.beg;
+      struct bnpc_node* end = cache->order.end;
+      for (struct bnpc_node* node = beg->next; node != end; node = node->next) {
+        cache->func_evict(
+          node->elem + BNPC_CACHE_KEY_OFFSET(cache),
+          node->elem + BNPC_CACHE_VAL_OFFSET(cache));
+      }
+    }
+    // releases the entries
+    bnpc_hashmap_free(&cache->entries);
+    bnpc_list_free(&cache->order);
+  }
+
+  void* bnpc_cache_getp(struct bnpc_cache* cache, void* key) {
+    struct bnpc_node* node = bnpc_cache__find(cache, key);
+    if (!node) {
+      return NULL;
+    }
+    bnpc_cache__touch(cache, node);
+    return node->elem + BNPC_CACHE_VAL_OFFSET(cache);
+  }
+
+  bnp_int32 bnpc_cache_put(struct bnpc_cache* cache, void* key, void* value, bnp_size charge) {
+    // The charge is the entry's share of the capacity: 1 when the capacity
+    // counts entries, or the entry's size when it counts bytes.
+    struct bnpc_node* node = bnpc_cache__find(cache, key);
+    if (charge > cache->capacity) {
+      // An entry larger than the whole cache can never be stored; making
+      // room for it would only empty the cache. The previous entry with the
+      // same key is stale and is dropped; the value itself goes straight
+      // to the eviction function.
+      if (node) {
+        if (cache->func_evict) {
+          cache->func_evict(
+            node->elem + BNPC_CACHE_KEY_OFFSET(cache),
+            node->elem + BNPC_CACHE_VAL_OFFSET(cache));
+        }
+        bnpc_cache__drop(cache, node);
+      }
+      if (cache->func_evict) {
+        cache->func_evict(key, value);
+      }
+      return 0;
+    }
+    if (node) {
+      // An entry with the same key already exists; its value is replaced
+      // and the previous value is handed to the eviction function.
+      struct bnpc_cache_entry* entry = (struct bnpc_cache_entry*)node->elem;
+      if (cache->func_evict) {
+        cache->func_evict(
+          node->elem + BNPC_CACHE_KEY_OFFSET(cache),
+          node->elem + BNPC_CACHE_VAL_OFFSET(cache));
+      }
+      memcpy(node->elem + BNPC_CACHE_VAL_OFFSET(cache), value, cache->v_size);
+      cache->usage -= entry->charge;
+      entry->charge = charge;
+      bnpc_cache__touch(cache, node);
+    } else {
+      // Builds the element in a buffer; bnpc_list_insert copies it into a
+      // new node at the front of the list.
+      bnp_byte* buffer = BNP_ALLOC(BNPC_CACHE_ELEMENT_SIZE(cache));
+      struct bnpc_cache_entry entry;
+      entry.charge = charge;
+      entry.referenced = 0;
+      memcpy(buffer, &entry, sizeof entry);
+      memcpy(buffer + BNPC_CACHE_KEY_OFFSET(cache), key  , cache->k_size);
+      memcpy(buffer + BNPC_CACHE_VAL_OFFSET(cache), value, cache->v_size);
+      node = bnpc_list_insert(&cache->order, buffer);
+      bnpc_hashmap_insert(&cache->entries, key, &node);
+      // releases the buffer
+      BNP_FREE(buffer);
+    }
+    cache->usage += charge;
+    // evicts entries until the usage fits the capacity again
+    while (cache->usage > cache->capacity && bnpc_cache_evict(cache));
+    return 1;
+  }
+
+  bnp_int32 bnpc_cache_remove(struct bnpc_cache* cache, void* key, void* value) {
+    struct bnpc_node* node = bnpc_cache__find(cache, key);
+    if (!node) {
+      return 0;
+    }
+    memcpy(value, node->elem + BNPC_CACHE_VAL_OFFSET(cache), cache->v_size);
+    bnpc_cache__drop(cache, node);
+    return 1;
+  }
+
+  bnp_int32 bnpc_cache_erase(struct bnpc_cache* cache, void* key) {
+    struct bnpc_node* node = bnpc_cache__find(cache, key);
+    if (!node) {
+      return 0;
+    }
+    bnpc_cache__drop(cache, node);
+    return 1;
+  }
+
+  bnp_int32 bnpc_cache_evict(struct bnpc_cache* cache) {
+    if (bnpc_list_empty(&cache->order)) {
+      return 0;
+    }
+    // The back of the list holds the oldest entry. With CLOCK, referenced
+    // entries get a second chance: their mark is cleared and they move to
+    // the front. Every mark is cleared after one pass; therefore, the loop
+    // terminates and each relink is paid for by an earlier hit.
+    struct bnpc_node* node = bnpc_list_end(&cache->order);
+    while (((struct bnpc_cache_entry*)node->elem)->referenced) {
+      ((struct bnpc_cache_entry*)node->elem)->referenced = 0;
+      bnpc_list_move(&cache->order, node);
+      node = bnpc_list_end(&cache->order);
+    }
+    if (cache->func_evict) {
+      cache->func_evict(
+        node->elem + BNPC_CACHE_KEY_OFFSET(cache),
+        node->elem + BNPC_CACHE_VAL_OFFSET(cache));
+    }
+    bnpc_cache__drop(cache, node);
+    return 1;
+  }
+#endif
+#endif
@@ -21,7 +21,8 @@ void              bnpc_node_free   (struct bnpc_node*);
 void              bnpc_list_init   (struct bnpc_list*, const bnp_size);
 void              bnpc_list_free   (struct bnpc_list*);
 bnp_int32         bnpc_list_empty  (struct bnpc_list*);
-void              bnpc_list_insert (struct bnpc_list*, void*);
+struct bnpc_node* bnpc_list_insert (struct bnpc_list*, void*);
+void              bnpc_list_move   (struct bnpc_list*, struct bnpc_node*);
 void              bnpc_list_remove (struct bnpc_list*, struct bnpc_node*, void*);
 void              bnpc_list_erase  (struct bnpc_list*, struct bnpc_node*);
 struct bnpc_node* bnpc_list_getp   (struct bnpc_list*, bnp_size);
@@ -52,11 +53,26 @@ struct bnpc_node* bnpc_list_end    (struct bnpc_list*);
            (list->end->prev == list->beg);
   }
 
-  void bnpc_list_insert(struct bnpc_list* list, void* elem) {
+  struct bnpc_node* bnpc_list_insert(struct bnpc_list* list, void* elem) {
     struct bnpc_node* node = bnpc_node_init(list->beg->next, list->beg, NULL);
     node->elem = BNP_ALLOC(list->elem_size);
     memcpy(node->elem, elem, list->elem_size);
     list->count++;
+    return node;
+  }
+
+  void bnpc_list_move(struct bnpc_list* list, struct bnpc_node* node) {
+    #ifdef BNPC_LIST_DEBUG
+      assert(node != list->beg && node != list->end);
+    #endif
+    // Unlinks the node and links it back in at the front; neither the
+    // node nor its element is reallocated.
+    node->next->prev = node->prev;
+    node->prev->next = node->next;
+    node->next = list->beg->next;
+    node->prev = list->beg;
+    node->next->prev = node;
+    node->prev->next = node;
   }
 
   void bnpc_list_remove(struct bnpc_list* list, struct bnpc_node* node, void* elem) {
@@ -0,0 +1,270 @@
+#ifndef BNPS_COMMON_H
+#define BNPS_COMMON_H
+
+#include "bnp_common.h"
+#include "bnpc_vector.h"
+#include <float.h>
+
+// Box and point tests are vectorized with SSE when it is available; each
+// test handles four boxes or four points stored as separate coordinate
+// arrays. Two-dimensional points keep a zero z coordinate so the same
+// tests serve both cases.
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+  #include <xmmintrin.h>
+  #define BNPS_SIMD
+#endif
+
+// bounded max-heap used by the k-nearest queries
+struct bnps_knn {
+  bnp_uint32* ids; // point indices
+  float* dist2; // squared distances
+  bnp_size count; // current count
+  bnp_size k; // maximum count
+};
+
+BNP_FORCE_INLINE void bnps__load(float* dst, const float* src, bnp_size dimensions) {
+  // copies the coordinates and zeroes the padding
+  dst[0] = dst[1] = dst[2] = dst[3] = 0.0f;
+  for (bnp_size i = 0; i < dimensions; i++) {
+    dst[i] = src[i];
+  }
+}
+
+BNP_FORCE_INLINE float bnps__box_dist2(const float* min, const float* max, const float* point) {
+  // squared distance from a point to a box; zero when the point is inside
+  float dist2 = 0.0f;
+  for (bnp_size i = 0; i < 3; i++) {
+    float d = 0.0f;
+    if (point[i] < min[i]) d = min[i] - point[i];
+    if (point[i] > max[i]) d = point[i] - max[i];
+    dist2 += d * d;
+  }
+  return dist2;
+}
+
+BNP_FORCE_INLINE bnp_int32 bnps__point_box(float x, float y, float z, const float* min, const float* max) {
+  return (x >= min[0]) && (x <= max[0]) &&
+         (y >= min[1]) && (y <= max[1]) &&
+         (z >= min[2]) && (z <= max[2]);
+}
+
+BNP_FORCE_INLINE float bnps__point_dist2(float x, float y, float z, const float* point) {
+  float dx = x - point[0];
+  float dy = y - point[1];
+  float dz = z - point[2];
+  return dx * dx + dy * dy + dz * dz;
+}
+
+BNP_FORCE_INLINE bnp_int32 bnps__mask4_box(
+  const float* xs,
+  const float* ys,
+  const float* zs,
+  const float* min,
+  const float* max) {
+  // Tests four consecutive points against a box; bit i of the result is
+  // set when point i is inside.
+  #ifdef BNPS_SIMD
+    __m128 x = _mm_loadu_ps(xs);
+    __m128 y = _mm_loadu_ps(ys);
+    __m128 z = _mm_loadu_ps(zs);
+    __m128 in = _mm_and_ps(
+      _mm_cmpge_ps(x, _mm_set1_ps(min[0])),
+      _mm_cmple_ps(x, _mm_set1_ps(max[0])));
+    in = _mm_and_ps(in, _mm_cmpge_ps(y, _mm_set1_ps(min[1])));
+    in = _mm_and_ps(in, _mm_cmple_ps(y, _mm_set1_ps(max[1])));
+    in = _mm_and_ps(in, _mm_cmpge_ps(z, _mm_set1_ps(min[2])));
+    in = _mm_and_ps(in, _mm_cmple_ps(z, _mm_set1_ps(max[2])));
+    return _mm_movemask_ps(in);
+  #else
+    bnp_int32 mask = 0;
+    for (bnp_size i = 0; i < 4; i++) {
+      mask |= bnps__point_box(xs[i], ys[i], zs[i], min, max) << i;
+    }
+    return mask;
+  #endif
+}
+
+BNP_FORCE_INLINE void bnps__dist4(
+  const float* xs,
+  const float* ys,
+  const float* zs,
+  const float* point,
+  float* dist2) {
+  // squared distances from four consecutive points to a point
+  #ifdef BNPS_SIMD
+    __m128 dx = _mm_sub_ps(_mm_loadu_ps(xs), _mm_set1_ps(point[0]));
+    __m128 dy = _mm_sub_ps(_mm_loadu_ps(ys), _mm_set1_ps(point[1]));
+    __m128 dz = _mm_sub_ps(_mm_loadu_ps(zs), _mm_set1_ps(point[2]));
+    _mm_storeu_ps(dist2, _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz)));
+  #else
+    for (bnp_size i = 0; i < 4; i++) {
+      dist2[i] = bnps__point_dist2(xs[i], ys[i], zs[i], point);
+    }
+  #endif
+}
+
+BNP_FORCE_INLINE bnp_int32 bnps__mask4_overlap(
+  const float* minx,
+  const float* miny,
+  const float* minz,
+  const float* maxx,
+  const float* maxy,
+  const float* maxz,
+  const float* min,
+  const float* max) {
+  // Tests four boxes, stored as separate bounds arrays, against a box; bit
+  // i of the result is set when box i overlaps it.
+  #ifdef BNPS_SIMD
+    __m128 out = _mm_or_ps(
+      _mm_cmplt_ps(_mm_loadu_ps(maxx), _mm_set1_ps(min[0])),
+      _mm_cmpgt_ps(_mm_loadu_ps(minx), _mm_set1_ps(max[0])));
+    out = _mm_or_ps(out, _mm_cmplt_ps(_mm_loadu_ps(maxy), _mm_set1_ps(min[1])));
+    out = _mm_or_ps(out, _mm_cmpgt_ps(_mm_loadu_ps(miny), _mm_set1_ps(max[1])));
+    out = _mm_or_ps(out, _mm_cmplt_ps(_mm_loadu_ps(maxz), _mm_set1_ps(min[2])));
+    out = _mm_or_ps(out, _mm_cmpgt_ps(_mm_loadu_ps(minz), _mm_set1_ps(max[2])));
+    return _mm_movemask_ps(out) ^ 0xF;
+  #else
+    bnp_int32 mask = 0;
+    for (bnp_size i = 0; i < 4; i++) {
+      bnp_int32 out = (maxx[i] < min[0]) || (minx[i] > max[0]) ||
+                      (maxy[i] < min[1]) || (miny[i] > max[1]) ||
+                      (maxz[i] < min[2]) || (minz[i] > max[2]);
+      mask |= !out << i;
+    }
+    return mask;
+  #endif
+}
+
+BNP_FORCE_INLINE void bnps__dist4_box(
+  const float* minx,
+  const float* miny,
+  const float* minz,
+  const float* maxx,
+  const float* maxy,
+  const float* maxz,
+  const float* point,
+  float* dist2) {
+  // squared distances from a point to four boxes stored as separate bounds
+  #ifdef BNPS_SIMD
+    __m128 zero = _mm_setzero_ps();
+    __m128 px = _mm_set1_ps(point[0]);
+    __m128 py = _mm_set1_ps(point[1]);
+    __m128 pz = _mm_set1_ps(point[2]);
+    __m128 dx = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(minx), px), _mm_sub_ps(px, _mm_loadu_ps(maxx))), zero);
+    __m128 dy = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(miny), py), _mm_sub_ps(py, _mm_loadu_ps(maxy))), zero);
+    __m128 dz = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(minz), pz), _mm_sub_ps(pz, _mm_loadu_ps(maxz))), zero);
+    _mm_storeu_ps(dist2, _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz)));
+  #else
+    for (bnp_size i = 0; i < 4; i++) {
+      float min[3] = { minx[i], miny[i], minz[i] };
+      float max[3] = { maxx[i], maxy[i], maxz[i] };
+      dist2[i] = bnps__box_dist2(min, max, point);
+    }
+  #endif
+}
+
+BNP_FORCE_INLINE bnp_int32 bnps__mask4_sphere(
+  const float* xs,
+  const float* ys,
+  const float* zs,
+  const float* center,
+  float radius2) {
+  // Tests four consecutive points against a sphere; bit i of the result
+  // is set when point i is inside.
+  #ifdef BNPS_SIMD
+    __m128 dx = _mm_sub_ps(_mm_loadu_ps(xs), _mm_set1_ps(center[0]));
+    __m128 dy = _mm_sub_ps(_mm_loadu_ps(ys), _mm_set1_ps(center[1]));
+    __m128 dz = _mm_sub_ps(_mm_loadu_ps(zs), _mm_set1_ps(center[2]));
+    __m128 d2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+    return _mm_movemask_ps(_mm_cmple_ps(d2, _mm_set1_ps(radius2)));
+  #else
+    bnp_int32 mask = 0;
+    for (bnp_size i = 0; i < 4; i++) {
+      mask |= (bnps__point_dist2(xs[i], ys[i], zs[i], center) <= radius2) << i;
+    }
+    return mask;
+  #endif
+}
+
+BNP_FORCE_INLINE void bnps_knn_init(struct bnps_knn* knn, bnp_size k) {
+  knn->ids = BNP_ALLOC(sizeof(bnp_uint32) * k);
+  knn->dist2 = BNP_ALLOC(sizeof(float) * k);
+  knn->count = 0;
+  knn->k = k;
+}
+
+BNP_FORCE_INLINE void bnps_knn_free(struct bnps_knn* knn) {
+  BNP_FREE(knn->ids);
+  BNP_FREE(knn->dist2);
+}
+
+BNP_FORCE_INLINE float bnps_knn_worst(struct bnps_knn* knn) {
+  // Candidates farther than the worst distance cannot enter the heap;
+  // until the heap is full, every candidate is accepted.
+  return (knn->count < knn->k) ? FLT_MAX : knn->dist2[0];
+}
+
+BNP_FORCE_INLINE bnp_int32 bnps_knn_prunes(struct bnps_knn* knn, float dist2) {
+  // Once the heap is full, nothing at or beyond the worst distance can
+  // enter it (bnps_knn_offer requires a strictly smaller distance); ties
+  // are pruned as well, so duplicate points do not defeat the pruning.
+  return (knn->count == knn->k) && (dist2 >= knn->dist2[0]);
+}
+
+BNP_FORCE_INLINE void bnps_knn__sift(struct bnps_knn* knn, bnp_size index, bnp_size count) {
+  // moves the element at index down until the heap property holds
+  for (;;) {
+    bnp_size child = (index << 1) + 1;
+    if (child >= count) break;
+    if (child + 1 < count && knn->dist2[child + 1] > knn->dist2[child]) child++;
+    if (knn->dist2[child] <= knn->dist2[index]) break;
+    bnp_uint32 id = knn->ids[index];
+    float dist2 = knn->dist2[index];
+    knn->ids[index] = knn->ids[child];
+    knn->dist2[index] = knn->dist2[child];
+    knn->ids[child] = id;
+    knn->dist2[child] = dist2;
+    index = child;
+  }
+}
+
+BNP_FORCE_INLINE void bnps_knn_offer(struct bnps_knn* knn, bnp_uint32 id, float dist2) {
+  if (knn->count < knn->k) {
+    // moves the new element up until the heap property holds
+    bnp_size index = knn->count++;
+    while (index > 0) {
+      bnp_size parent = (index - 1) >> 1;
+      if (knn->dist2[parent] >= dist2) break;
+      knn->ids[index] = knn->ids[parent];
+      knn->dist2[index] = knn->dist2[parent];
+      index = parent;
+    }
+    knn->ids[index] = id;
+    knn->dist2[index] = dist2;
+  } else if (dist2 < knn->dist2[0]) {
+    // replaces the worst element
+    knn->ids[0] = id;
+    knn->dist2[0] = dist2;
+    bnps_knn__sift(knn, 0, knn->count);
+  }
+}
+
+BNP_FORCE_INLINE void bnps_knn_flush(struct bnps_knn* knn, struct bnpc_vector* results) {
+  // Sorts the heap in place (the worst element moves to the back on each
+  // pass) so that the results are appended nearest first.
+  for (bnp_size count = knn->count; count > 1; count--) {
+    bnp_uint32 id = knn->ids[0];
+    float dist2 = knn->dist2[0];
+    knn->ids[0] = knn->ids[count - 1];
+    knn->dist2[0] = knn->dist2[count - 1];
+    knn->ids[count - 1] = id;
+    knn->dist2[count - 1] = dist2;
+    bnps_knn__sift(knn, 0, count - 1);
+  }
+  for (bnp_size i = 0; i < knn->count; i++) {
+    bnpc_vector_push(results, &knn->ids[i]);
+  }
+  knn->count = 0;
+}
+
+#endif
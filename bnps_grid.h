@@ -0,0 +1,385 @@
+#ifndef BNPS_GRID_H
+#define BNPS_GRID_H
+
+#include "bnp_common.h"
+#include "bnpc_vector.h"
+#include "bnps_common.h"
+
+struct bnps_grid {
+  struct bnpc_vector xs; // x coordinates (bucket order)
+  struct bnpc_vector ys; // y coordinates (bucket order)
+  struct bnpc_vector zs; // z coordinates (bucket order)
+  struct bnpc_vector ids; // point indices (bucket order)
+  struct bnpc_vector starts; // first point of each bucket (bucket_count + 1)
+  bnp_int32 lo[3]; // lowest occupied cell
+  bnp_int32 hi[3]; // highest occupied cell
+  float cell_size; // cell edge length
+  float inv_cell_size; // reciprocal of cell_size
+  bnp_size bucket_count; // bucket count (power of two)
+  bnp_size dimensions; // coordinates per point (2 or 3)
+};
+
+void bnps_grid_init    (struct bnps_grid* grid, bnp_size dimensions, float cell_size);
+void bnps_grid_free    (struct bnps_grid* grid);
+void bnps_grid_build   (struct bnps_grid* grid, const float* points, bnp_size count);
+void bnps_grid_range   (struct bnps_grid* grid, const float* min, const float* max, struct bnpc_vector* results);
+void bnps_grid_radius  (struct bnps_grid* grid, const float* center, float radius, struct bnpc_vector* results);
+void bnps_grid_nearest (struct bnps_grid* grid, const float* point, bnp_size k, struct bnpc_vector* results);
+
+#ifdef BNPS_GRID_IMPLEMENTATION
+  #include <assert.h>
+  #include <math.h>
+  #include <string.h>
+
+  static void bnps_grid__vectors(struct bnps_grid* grid, bnp_size count) {
+    // reserves the points and bucket offsets up-front
+    bnp_size reserved = count ? count : 1;
+    bnpc_vector_init(&grid->xs, sizeof(float), reserved);
+    bnpc_vector_init(&grid->ys, sizeof(float), reserved);
+    bnpc_vector_init(&grid->zs, sizeof(float), reserved);
+    bnpc_vector_init(&grid->ids, sizeof(bnp_uint32), reserved);
+    bnpc_vector_init(&grid->starts, sizeof(bnp_uint32), grid->bucket_count + 1);
+  }
+
+  static bnp_int32 bnps_grid__cell(struct bnps_grid* grid, float value) {
+    // clamps the cell to the range of bnp_int32
+    float cell = floorf(value * grid->inv_cell_size);
+    if (cell < -2147483648.0f) return (bnp_int32)-2147483647 - 1;
+    if (cell >= 2147483648.0f) return (bnp_int32)2147483647;
+    return (bnp_int32)cell;
+  }
+
+  static bnp_size bnps_grid__bucket(struct bnps_grid* grid, bnp_int64 x, bnp_int64 y, bnp_int64 z) {
+    // Spreads the cell coordinates with large primes and finalizes the
+    // result (murmur3's fmix32) so that the low bits, which select the
+    // bucket, depend on every coordinate.
+    bnp_uint32 h = ((bnp_uint32)x * 73856093u) ^
+                   ((bnp_uint32)y * 19349663u) ^
+                   ((bnp_uint32)z * 83492791u);
+    h ^= h >> 16;
+    h *= 0x85EBCA6Bu;
+    h ^= h >> 13;
+    h *= 0xC2B2AE35u;
+    h ^= h >> 16;
+    return h & (grid->bucket_count - 1);
+  }
+
+  static bnp_int32 bnps_grid__owns(struct bnps_grid* grid, bnp_size i, const bnp_int64* cell) {
+    // Distinct cells may share a bucket; a point is only reported for the
+    // cell it actually belongs to, which prevents duplicate results.
+    return bnps_grid__cell(grid, ((float*)grid->xs.elements)[i]) == cell[0] &&
+           bnps_grid__cell(grid, ((float*)grid->ys.elements)[i]) == cell[1] &&
+           bnps_grid__cell(grid, ((float*)grid->zs.elements)[i]) == cell[2];
+  }
+
+  void bnps_grid_init(struct bnps_grid* grid, bnp_size dimensions, float cell_size) {
+    #ifdef BNPS_GRID_DEBUG
+      assert(dimensions >= 1 && dimensions <= 3);
+      assert(cell_size > 0.0f);
+    #endif
+    grid->dimensions = dimensions; // coordinates per point
+    grid->cell_size = cell_size; // cell edge length
+    grid->inv_cell_size = 1.0f / cell_size; // reciprocal of cell_size
+    grid->bucket_count = 1; // single (empty) bucket
+    memset(grid->lo, 0, sizeof grid->lo);
+    memset(grid->hi, 0, sizeof grid->hi);
+    bnps_grid__vectors(grid, 0);
+    bnp_uint32 zero = 0;
+    bnpc_vector_push(&grid->starts, &zero);
+    bnpc_vector_push(&grid->starts, &zero);
+  }
+
+  void bnps_grid_free(struct bnps_grid* grid) {
+    // releases the points and buckets
+    bnpc_vector_free(&grid->xs);
+    bnpc_vector_free(&grid->ys);
+    bnpc_vector_free(&grid->zs);
+    bnpc_vector_free(&grid->ids);
+    bnpc_vector_free(&grid->starts);
+  }
+
+  void bnps_grid_build(struct bnps_grid* grid, const float* points, bnp_size count) {
+    #ifdef BNPS_GRID_DEBUG
+      assert(count < 0xFFFFFFFFULL);
+    #endif
+    // discards the previous contents
+    bnps_grid_free(grid);
+    // The bucket count is the smallest power of two that holds one point
+    // per bucket; this keeps the buckets short and makes the modulo a mask.
+    grid->bucket_count = 1;
+    while (grid->bucket_count < count) {
+      grid->bucket_count <<= 1;
+    }
+    bnps_grid__vectors(grid, count);
+    bnp_uint32 zero = 0;
+    for (bnp_size i = 0; i <= grid->bucket_count; i++) {
+      bnpc_vector_push(&grid->starts, &zero);
+    }
+    memset(grid->lo, 0, sizeof grid->lo);
+    memset(grid->hi, 0, sizeof grid->hi);
+    if (count == 0) {
+      return;
+    }
+    bnp_uint32* starts = grid->starts.elements;
+    bnp_uint32* buckets = BNP_ALLOC(sizeof(bnp_uint32) * count);
+    bnp_uint32* order = BNP_ALLOC(sizeof(bnp_uint32) * count);
+    float* padded = BNP_ALLOC(sizeof(float) * 4 * count);
+    // assigns the points to buckets and counts the bucket sizes
+    for (bnp_size i = 0; i < count; i++) {
+      float* point = padded + i * 4;
+      bnps__load(point, points + i * grid->dimensions, grid->dimensions);
+      bnp_int32 cell[3];
+      for (bnp_size axis = 0; axis < 3; axis++) {
+        cell[axis] = bnps_grid__cell(grid, point[axis]);
+        if (i == 0 || cell[axis] < grid->lo[axis]) grid->lo[axis] = cell[axis];
+        if (i == 0 || cell[axis] > grid->hi[axis]) grid->hi[axis] = cell[axis];
+      }
+      buckets[i] = (bnp_uint32)bnps_grid__bucket(grid, cell[0], cell[1], cell[2]);
+      starts[buckets[i] + 1]++;
+    }
+    // Converts the sizes into offsets and places the points with a
+    // counting sort; each bucket's points end up contiguous.
+    for (bnp_size i = 0; i < grid->bucket_count; i++) {
+      starts[i + 1] += starts[i];
+    }
+    for (bnp_size i = 0; i < count; i++) {
+      order[starts[buckets[i]]++] = (bnp_uint32)i;
+    }
+    // the placement advanced each offset to the next bucket; shifts them back
+    for (bnp_size i = grid->bucket_count; i > 0; i--) {
+      starts[i] = starts[i - 1];
+    }
+    starts[0] = 0;
+    for (bnp_size i = 0; i < count; i++) {
+      float* point = padded + (bnp_size)order[i] * 4;
+      bnpc_vector_push(&grid->xs, point + 0);
+      bnpc_vector_push(&grid->ys, point + 1);
+      bnpc_vector_push(&grid->zs, point + 2);
+      bnpc_vector_push(&grid->ids, order + i);
+    }
+    // releases the buffers
+    BNP_FREE(buckets);
+    BNP_FREE(order);
+    BNP_FREE(padded);
+  }
+
+  static void bnps_grid__collect(
+    struct bnps_grid* grid,
+    bnp_size beg,
+    bnp_size end,
+    const bnp_int64* cell,
+    const float* min,
+    const float* max,
+    const float* center,
+    float radius2,
+    struct bnpc_vector* results) {
+    // Collects the points in [beg, end) within the box; when center is
+    // provided, the points must also be within radius2 of it. When cell is
+    // provided, only the points belonging to that cell are reported.
+    const float* xs = grid->xs.elements;
+    const float* ys = grid->ys.elements;
+    const float* zs = grid->zs.elements;
+    bnp_uint32* ids = grid->ids.elements;
+    bnp_size i = beg;
+    // tests four points at a time
+    for (; i + 4 <= end; i += 4) {
+      bnp_int32 mask = bnps__mask4_box(xs + i, ys + i, zs + i, min, max);
+      if (center) {
+        mask &= bnps__mask4_sphere(xs + i, ys + i, zs + i, center, radius2);
+      }
+      for (bnp_size j = 0; mask; j++, mask >>= 1) {
+        if (!(mask & 1)) continue;
+        if (cell && !bnps_grid__owns(grid, i + j, cell)) continue;
+        bnpc_vector_push(results, ids + i + j);
+      }
+    }
+    // tests the remaining points
+    for (; i < end; i++) {
+      if (!bnps__point_box(xs[i], ys[i], zs[i], min, max)) continue;
+      if (center && bnps__point_dist2(xs[i], ys[i], zs[i], center) > radius2) continue;
+      if (cell && !bnps_grid__owns(grid, i, cell)) continue;
+      bnpc_vector_push(results, ids + i);
+    }
+  }
+
+  static void bnps_grid__query(
+    struct bnps_grid* grid,
+    const float* min,
+    const float* max,
+    const float* center,
+    float radius2,
+    struct bnpc_vector* results) {
+    #ifdef BNPS_GRID_DEBUG
+      assert(results->element_size == sizeof(bnp_uint32));
+    #endif
+    if (grid->ids.count == 0) {
+      return;
+    }
+    // limits the cells to the occupied ones
+    bnp_int64 lo[3];
+    bnp_int64 hi[3];
+    bnp_uint64 cells = 1;
+    for (bnp_size axis = 0; axis < 3; axis++) {
+      lo[axis] = bnps_grid__cell(grid, min[axis]);
+      hi[axis] = bnps_grid__cell(grid, max[axis]);
+      if (lo[axis] < grid->lo[axis]) lo[axis] = grid->lo[axis];
+      if (hi[axis] > grid->hi[axis]) hi[axis] = grid->hi[axis];
+      if (lo[axis] > hi[axis]) {
+        return;
+      }
+      cells *= (bnp_uint64)(hi[axis] - lo[axis] + 1);
+      if (cells > grid->bucket_count) break;
+    }
+    // When the query covers more cells than there are buckets, every
+    // bucket would be visited anyway; scanning the points directly is
+    // cheaper and needs no ownership tests.
+    if (cells > grid->bucket_count) {
+      bnps_grid__collect(grid, 0, grid->ids.count, NULL, min, max, center, radius2, results);
+      return;
+    }
+    const bnp_uint32* starts = grid->starts.elements;
+    bnp_int64 cell[3];
+    for (cell[2] = lo[2]; cell[2] <= hi[2]; cell[2]++) {
+      for (cell[1] = lo[1]; cell[1] <= hi[1]; cell[1]++) {
+        for (cell[0] = lo[0]; cell[0] <= hi[0]; cell[0]++) {
+          bnp_size bucket = bnps_grid__bucket(grid, cell[0], cell[1], cell[2]);
+          bnps_grid__collect(grid, starts[bucket], starts[bucket + 1], cell, min, max, center, radius2, results);
+        }
+      }
+    }
+  }
+
+  void bnps_grid_range(struct bnps_grid* grid, const float* min, const float* max, struct bnpc_vector* results) {
+    float qmin[4];
+    float qmax[4];
+    bnps__load(qmin, min, grid->dimensions);
+    bnps__load(qmax, max, grid->dimensions);
+    bnps_grid__query(grid, qmin, qmax, NULL, 0.0f, results);
+  }
+
+  void bnps_grid_radius(struct bnps_grid* grid, const float* center, float radius, struct bnpc_vector* results) {
+    // The sphere is bounded by a box; the box selects the cells and the
+    // sphere refines the points.
+    float qcenter[4];
+    float qmin[4];
+    float qmax[4];
+    bnps__load(qcenter, center, grid->dimensions);
+    bnps__load(qmin, center, grid->dimensions);
+    bnps__load(qmax, center, grid->dimensions);
+    for (bnp_size i = 0; i < grid->dimensions; i++) {
+      qmin[i] -= radius;
+      qmax[i] += radius;
+    }
+    bnps_grid__query(grid, qmin, qmax, qcenter, radius * radius, results);
+  }
+
+  static void bnps_grid__nearest(struct bnps_grid* grid, const bnp_int64* cell, const float* p, struct bnps_knn* knn) {
+    // offers the points of a single cell to the heap
+    const bnp_uint32* starts = grid->starts.elements;
+    const float* xs = grid->xs.elements;
+    const float* ys = grid->ys.elements;
+    const float* zs = grid->zs.elements;
+    const bnp_uint32* ids = grid->ids.elements;
+    bnp_size bucket = bnps_grid__bucket(grid, cell[0], cell[1], cell[2]);
+    for (bnp_size i = starts[bucket]; i < starts[bucket + 1]; i++) {
+      float dist2 = bnps__point_dist2(xs[i], ys[i], zs[i], p);
+      // the ownership test is only needed for points entering the heap
+      if (dist2 < bnps_knn_worst(knn) && bnps_grid__owns(grid, i, cell)) {
+        bnps_knn_offer(knn, ids[i], dist2);
+      }
+    }
+  }
+
+  static void bnps_grid__nearest_all(struct bnps_grid* grid, const float* p, struct bnps_knn* knn) {
+    // Offers every point to an emptied heap; each point is seen exactly
+    // once, so no ownership tests are needed.
+    const float* xs = grid->xs.elements;
+    const float* ys = grid->ys.elements;
+    const float* zs = grid->zs.elements;
+    const bnp_uint32* ids = grid->ids.elements;
+    knn->count = 0;
+    for (bnp_size i = 0; i < grid->ids.count; i++) {
+      bnps_knn_offer(knn, ids[i], bnps__point_dist2(xs[i], ys[i], zs[i], p));
+    }
+  }
+
+  void bnps_grid_nearest(struct bnps_grid* grid, const float* point, bnp_size k, struct bnpc_vector* results) {
+    #ifdef BNPS_GRID_DEBUG
+      assert(results->element_size == sizeof(bnp_uint32));
+    #endif
+    if (grid->ids.count == 0 || k == 0) {
+      return;
+    }
+    float p[4];
+    bnps__load(p, point, grid->dimensions);
+    struct bnps_knn knn;
+    bnps_knn_init(&knn, k);
+    // When every point is requested, the rings cannot stop early; a single
+    // pass over the points is cheaper.
+    if (k >= grid->ids.count) {
+      bnps_grid__nearest_all(grid, p, &knn);
+      bnps_knn_flush(&knn, results);
+      bnps_knn_free(&knn);
+      return;
+    }
+    // The cells are visited in rings of growing (Chebyshev) distance from
+    // the query's cell; the rings start at the first occupied cell and end
+    // at the last one.
+    bnp_int64 c[3];
+    bnp_int64 ring_beg = 0;
+    bnp_int64 ring_end = 0;
+    for (bnp_size axis = 0; axis < 3; axis++) {
+      c[axis] = bnps_grid__cell(grid, p[axis]);
+      bnp_int64 below = grid->lo[axis] - c[axis];
+      bnp_int64 above = c[axis] - grid->hi[axis];
+      if (below > ring_beg) ring_beg = below;
+      if (above > ring_beg) ring_beg = above;
+      if (-below > ring_end) ring_end = -below;
+      if (-above > ring_end) ring_end = -above;
+    }
+    // Sparse or clustered points can leave many empty cells between the
+    // query and its neighbours. Once the rings have cost as much as a pass
+    // over the buckets and points, that pass finishes the query instead.
+    bnp_size visited = 0;
+    bnp_size limit = grid->bucket_count + grid->ids.count;
+    for (bnp_int64 r = ring_beg; r <= ring_end && visited <= limit; r++) {
+      bnp_int64 lo[3];
+      bnp_int64 hi[3];
+      for (bnp_size axis = 0; axis < 3; axis++) {
+        lo[axis] = (c[axis] - r > grid->lo[axis]) ? c[axis] - r : grid->lo[axis];
+        hi[axis] = (c[axis] + r < grid->hi[axis]) ? c[axis] + r : grid->hi[axis];
+      }
+      bnp_int64 cell[3];
+      for (cell[2] = lo[2]; cell[2] <= hi[2] && visited <= limit; cell[2]++) {
+        for (cell[1] = lo[1]; cell[1] <= hi[1] && visited <= limit; cell[1]++) {
+          // Rows on the ring's faces are visited entirely; the other rows
+          // only contribute their two end cells.
+          bnp_int32 face = (cell[2] == c[2] - r) || (cell[2] == c[2] + r) ||
+                           (cell[1] == c[1] - r) || (cell[1] == c[1] + r);
+          visited++;
+          if (face) {
+            for (cell[0] = lo[0]; cell[0] <= hi[0] && visited <= limit; cell[0]++, visited++) {
+              bnps_grid__nearest(grid, cell, p, &knn);
+            }
+            continue;
+          }
+          if ((cell[0] = c[0] - r) >= lo[0]) bnps_grid__nearest(grid, cell, p, &knn);
+          if ((cell[0] = c[0] + r) <= hi[0]) bnps_grid__nearest(grid, cell, p, &knn);
+          visited += 2;
+        }
+      }
+      // Points in the following rings are at least r cells away from the
+      // query; once the heap's worst distance is within that, it is final.
+      float bound = (float)r * grid->cell_size;
+      if (knn.count == knn.k && knn.dist2[0] <= bound * bound) {
+        break;
+      }
+    }
+    if (visited > limit) {
+      bnps_grid__nearest_all(grid, p, &knn);
+    }
+    bnps_knn_flush(&knn, results);
+    bnps_knn_free(&knn);
+  }
+#endif
+#endif
@@ -0,0 +1,403 @@
+#ifndef BNPS_TREE_H
+#define BNPS_TREE_H
+
+#include "bnp_common.h"
+#include "bnpc_vector.h"
+#include "bnps_common.h"
+
+// maximum points stored in a leaf
+#ifndef BNPS_TREE_LEAF_SIZE
+  #define BNPS_TREE_LEAF_SIZE 8
+#endif
+
+// maximum traversal stack (four-way median splits keep the depth below 16)
+#define BNPS_TREE_STACK_SIZE 64
+
+// Each node holds the bounds of up to four children as separate arrays, so
+// a single SIMD compare tests all four children against a query. Unused
+// slots have inverted bounds and refer to the root (node zero), which is
+// never a child.
+struct bnps_tree_node {
+  float minx[4]; // lower x bounds of the children
+  float miny[4]; // lower y bounds of the children
+  float minz[4]; // lower z bounds of the children
+  float maxx[4]; // upper x bounds of the children
+  float maxy[4]; // upper y bounds of the children
+  float maxz[4]; // upper z bounds of the children
+  bnp_uint32 child[4]; // first point (leaf) or node index (inner)
+  bnp_uint32 count[4]; // point count (leaf) or zero (inner)
+};
+
+struct bnps_tree {
+  struct bnpc_vector nodes; // nodes (pre-order; the root is the first)
+  struct bnpc_vector xs; // x coordinates (leaf order)
+  struct bnpc_vector ys; // y coordinates (leaf order)
+  struct bnpc_vector zs; // z coordinates (leaf order)
+  struct bnpc_vector ids; // point indices (leaf order)
+  bnp_size dimensions; // coordinates per point (2 or 3)
+};
+
+void bnps_tree_init    (struct bnps_tree* tree, bnp_size dimensions);
+void bnps_tree_free    (struct bnps_tree* tree);
+void bnps_tree_build   (struct bnps_tree* tree, const float* points, bnp_size count);
+void bnps_tree_range   (struct bnps_tree* tree, const float* min, const float* max, struct bnpc_vector* results);
+void bnps_tree_radius  (struct bnps_tree* tree, const float* center, float radius, struct bnpc_vector* results);
+void bnps_tree_nearest (struct bnps_tree* tree, const float* point, bnp_size k, struct bnpc_vector* results);
+
+#ifdef BNPS_TREE_IMPLEMENTATION
+  #include <assert.h>
+  #include <string.h>
+
+  static void bnps_tree__vectors(struct bnps_tree* tree, bnp_size count) {
+    // Median splits only divide ranges larger than l points, so every leaf
+    // holds at least (l + 1) / 2 of them. Every node has at least two
+    // children; therefore, a tree with n points has at most n / ((l + 1) / 2)
+    // + 1 nodes. Reserving them up-front avoids reallocations during the
+    // build.
+    bnp_size reserved = count ? count : 1;
+    bnpc_vector_init(&tree->nodes, sizeof(struct bnps_tree_node), reserved / ((BNPS_TREE_LEAF_SIZE + 1) >> 1) + 1);
+    bnpc_vector_init(&tree->xs, sizeof(float), reserved);
+    bnpc_vector_init(&tree->ys, sizeof(float), reserved);
+    bnpc_vector_init(&tree->zs, sizeof(float), reserved);
+    bnpc_vector_init(&tree->ids, sizeof(bnp_uint32), reserved);
+  }
+
+  static void bnps_tree__select(
+    const float* points,
+    bnp_uint32* perm,
+    bnp_int64 lo,
+    bnp_int64 hi,
+    bnp_int64 nth,
+    bnp_size axis) {
+    // Partially sorts perm[lo..hi] so that perm[nth] holds the median along
+    // the axis; smaller coordinates end up on its left and larger ones on
+    // its right (quickselect with Hoare partitioning).
+    while (lo < hi) {
+      float pivot = points[(bnp_size)perm[lo + ((hi - lo) >> 1)] * 4 + axis];
+      bnp_int64 i = lo;
+      bnp_int64 j = hi;
+      while (i <= j) {
+        while (points[(bnp_size)perm[i] * 4 + axis] < pivot) i++;
+        while (points[(bnp_size)perm[j] * 4 + axis] > pivot) j--;
+        if (i <= j) {
+          bnp_uint32 swap = perm[i];
+          perm[i++] = perm[j];
+          perm[j--] = swap;
+        }
+      }
+      if (nth <= j) {
+        hi = j;
+      } else if (nth >= i) {
+        lo = i;
+      } else {
+        break;
+      }
+    }
+  }
+
+  static void bnps_tree__bounds(
+    const float* points,
+    const bnp_uint32* perm,
+    bnp_size beg,
+    bnp_size end,
+    float* min,
+    float* max) {
+    // computes the bounds of the points
+    memcpy(min, points + (bnp_size)perm[beg] * 4, sizeof(float) * 3);
+    memcpy(max, points + (bnp_size)perm[beg] * 4, sizeof(float) * 3);
+    for (bnp_size i = beg + 1; i < end; i++) {
+      const float* point = points + (bnp_size)perm[i] * 4;
+      for (bnp_size axis = 0; axis < 3; axis++) {
+        if (point[axis] < min[axis]) min[axis] = point[axis];
+        if (point[axis] > max[axis]) max[axis] = point[axis];
+      }
+    }
+  }
+
+  static bnp_uint32 bnps_tree__build(
+    struct bnps_tree* tree,
+    const float* points,
+    bnp_uint32* perm,
+    bnp_size beg,
+    bnp_size end) {
+    // Splits the range into up to four children: two rounds of median
+    // splits along the longest axis of each part. Parts of at most
+    // BNPS_TREE_LEAF_SIZE points are not split further.
+    bnp_size parts[5] = { beg, end };
+    bnp_size count = 1;
+    for (bnp_size round = 0; round < 2; round++) {
+      bnp_size split[5];
+      bnp_size split_count = 0;
+      for (bnp_size i = 0; i < count; i++) {
+        split[split_count++] = parts[i];
+        if (parts[i + 1] - parts[i] > BNPS_TREE_LEAF_SIZE) {
+          float min[3];
+          float max[3];
+          bnps_tree__bounds(points, perm, parts[i], parts[i + 1], min, max);
+          bnp_size axis = 0;
+          for (bnp_size a = 1; a < 3; a++) {
+            if (max[a] - min[a] > max[axis] - min[axis]) axis = a;
+          }
+          bnp_size mid = parts[i] + ((parts[i + 1] - parts[i]) >> 1);
+          bnps_tree__select(points, perm, (bnp_int64)parts[i], (bnp_int64)parts[i + 1] - 1, (bnp_int64)mid, axis);
+          split[split_count++] = mid;
+        }
+      }
+      split[split_count] = end;
+      memcpy(parts, split, sizeof parts);
+      count = split_count;
+    }
+    // Nodes are stored in pre-order; the node is pushed before its
+    // children so that the root is always the first node.
+    struct bnps_tree_node node;
+    for (bnp_size i = 0; i < 4; i++) {
+      node.minx[i] = node.miny[i] = node.minz[i] =  FLT_MAX;
+      node.maxx[i] = node.maxy[i] = node.maxz[i] = -FLT_MAX;
+      node.child[i] = 0;
+      node.count[i] = 0;
+    }
+    bnp_uint32 index = (bnp_uint32)tree->nodes.count;
+    bnpc_vector_push(&tree->nodes, &node);
+    for (bnp_size i = 0; i < count; i++) {
+      float min[3];
+      float max[3];
+      bnps_tree__bounds(points, perm, parts[i], parts[i + 1], min, max);
+      node.minx[i] = min[0];
+      node.miny[i] = min[1];
+      node.minz[i] = min[2];
+      node.maxx[i] = max[0];
+      node.maxy[i] = max[1];
+      node.maxz[i] = max[2];
+      if (parts[i + 1] - parts[i] <= BNPS_TREE_LEAF_SIZE) {
+        node.child[i] = (bnp_uint32)parts[i];
+        node.count[i] = (bnp_uint32)(parts[i + 1] - parts[i]);
+      } else {
+        node.child[i] = bnps_tree__build(tree, points, perm, parts[i], parts[i + 1]);
+      }
+    }
+    // The vector may have been reallocated by the recursive calls;
+    // therefore, the node is retrieved again.
+    memcpy(bnpc_vector_getp(&tree->nodes, index), &node, sizeof node);
+    return index;
+  }
+
+  void bnps_tree_init(struct bnps_tree* tree, bnp_size dimensions) {
+    #ifdef BNPS_TREE_DEBUG
+      assert(dimensions >= 1 && dimensions <= 3);
+    #endif
+    tree->dimensions = dimensions; // coordinates per point
+    bnps_tree__vectors(tree, 0);
+  }
+
+  void bnps_tree_free(struct bnps_tree* tree) {
+    // releases the nodes and points
+    bnpc_vector_free(&tree->nodes);
+    bnpc_vector_free(&tree->xs);
+    bnpc_vector_free(&tree->ys);
+    bnpc_vector_free(&tree->zs);
+    bnpc_vector_free(&tree->ids);
+  }
+
+  void bnps_tree_build(struct bnps_tree* tree, const float* points, bnp_size count) {
+    #ifdef BNPS_TREE_DEBUG
+      assert(count < 0xFFFFFFFFULL);
+    #endif
+    // discards the previous contents
+    bnps_tree_free(tree);
+    bnps_tree__vectors(tree, count);
+    if (count == 0) {
+      return;
+    }
+    // The points are padded to four coordinates while building; this
+    // keeps the bounds computations independent of the dimensions.
+    float* padded = BNP_ALLOC(sizeof(float) * 4 * count);
+    bnp_uint32* perm = BNP_ALLOC(sizeof(bnp_uint32) * count);
+    for (bnp_size i = 0; i < count; i++) {
+      bnps__load(padded + i * 4, points + i * tree->dimensions, tree->dimensions);
+      perm[i] = (bnp_uint32)i;
+    }
+    bnps_tree__build(tree, padded, perm, 0, count);
+    // Stores the coordinates as separate arrays in leaf order; a leaf's
+    // points are contiguous, so they can be tested four at a time.
+    for (bnp_size i = 0; i < count; i++) {
+      float* point = padded + (bnp_size)perm[i] * 4;
+      bnpc_vector_push(&tree->xs, point + 0);
+      bnpc_vector_push(&tree->ys, point + 1);
+      bnpc_vector_push(&tree->zs, point + 2);
+      bnpc_vector_push(&tree->ids, perm + i);
+    }
+    // releases the buffers
+    BNP_FREE(padded);
+    BNP_FREE(perm);
+  }
+
+  static void bnps_tree__query(
+    struct bnps_tree* tree,
+    const float* min,
+    const float* max,
+    const float* center,
+    float radius2,
+    struct bnpc_vector* results) {
+    // Collects the points within the box; when center is provided, the
+    // points must also be within radius2 of it.
+    #ifdef BNPS_TREE_DEBUG
+      assert(results->element_size == sizeof(bnp_uint32));
+    #endif
+    if (tree->nodes.count == 0) {
+      return;
+    }
+    const struct bnps_tree_node* nodes = tree->nodes.elements;
+    const float* xs = tree->xs.elements;
+    const float* ys = tree->ys.elements;
+    const float* zs = tree->zs.elements;
+    bnp_uint32* ids = tree->ids.elements;
+    bnp_uint32 stack[BNPS_TREE_STACK_SIZE];
+    bnp_size top = 0;
+    stack[top++] = 0;
+    while (top) {
+      const struct bnps_tree_node* node = nodes + stack[--top];
+      // tests the four children at once
+      bnp_int32 mask = bnps__mask4_overlap(
+        node->minx, node->miny, node->minz,
+        node->maxx, node->maxy, node->maxz,
+        min, max);
+      for (bnp_size c = 0; mask; c++, mask >>= 1) {
+        if (!(mask & 1)) continue;
+        if (node->count[c] == 0) {
+          if (node->child[c] == 0) continue;
+          #ifdef BNPS_TREE_DEBUG
+            assert(top < BNPS_TREE_STACK_SIZE);
+          #endif
+          stack[top++] = node->child[c];
+          continue;
+        }
+        bnp_size i = node->child[c];
+        bnp_size end = i + node->count[c];
+        // tests four points at a time
+        for (; i + 4 <= end; i += 4) {
+          bnp_int32 hits = bnps__mask4_box(xs + i, ys + i, zs + i, min, max);
+          if (center) {
+            hits &= bnps__mask4_sphere(xs + i, ys + i, zs + i, center, radius2);
+          }
+          for (bnp_size j = 0; hits; j++, hits >>= 1) {
+            if (hits & 1) bnpc_vector_push(results, ids + i + j);
+          }
+        }
+        // tests the remaining points
+        for (; i < end; i++) {
+          if (!bnps__point_box(xs[i], ys[i], zs[i], min, max)) continue;
+          if (center && bnps__point_dist2(xs[i], ys[i], zs[i], center) > radius2) continue;
+          bnpc_vector_push(results, ids + i);
+        }
+      }
+    }
+  }
+
+  void bnps_tree_range(struct bnps_tree* tree, const float* min, const float* max, struct bnpc_vector* results) {
+    float qmin[4];
+    float qmax[4];
+    bnps__load(qmin, min, tree->dimensions);
+    bnps__load(qmax, max, tree->dimensions);
+    bnps_tree__query(tree, qmin, qmax, NULL, 0.0f, results);
+  }
+
+  void bnps_tree_radius(struct bnps_tree* tree, const float* center, float radius, struct bnpc_vector* results) {
+    // The sphere is bounded by a box; the box prunes the nodes and the
+    // sphere refines the points.
+    float qcenter[4];
+    float qmin[4];
+    float qmax[4];
+    bnps__load(qcenter, center, tree->dimensions);
+    bnps__load(qmin, center, tree->dimensions);
+    bnps__load(qmax, center, tree->dimensions);
+    for (bnp_size i = 0; i < tree->dimensions; i++) {
+      qmin[i] -= radius;
+      qmax[i] += radius;
+    }
+    bnps_tree__query(tree, qmin, qmax, qcenter, radius * radius, results);
+  }
+
+  void bnps_tree_nearest(struct bnps_tree* tree, const float* point, bnp_size k, struct bnpc_vector* results) {
+    #ifdef BNPS_TREE_DEBUG
+      assert(results->element_size == sizeof(bnp_uint32));
+    #endif
+    if (tree->nodes.count == 0 || k == 0) {
+      return;
+    }
+    float p[4];
+    bnps__load(p, point, tree->dimensions);
+    const struct bnps_tree_node* nodes = tree->nodes.elements;
+    const float* xs = tree->xs.elements;
+    const float* ys = tree->ys.elements;
+    const float* zs = tree->zs.elements;
+    const bnp_uint32* ids = tree->ids.elements;
+    struct bnps_knn knn;
+    bnps_knn_init(&knn, k);
+    // The stack holds children (node index or point range) along with
+    // their distances, so they can be skipped once the heap improves.
+    bnp_uint32 stack_child[BNPS_TREE_STACK_SIZE];
+    bnp_uint32 stack_count[BNPS_TREE_STACK_SIZE];
+    float stack_dist2[BNPS_TREE_STACK_SIZE];
+    bnp_size top = 0;
+    stack_child[top] = 0;
+    stack_count[top] = 0;
+    stack_dist2[top] = 0.0f;
+    top++;
+    while (top) {
+      top--;
+      // skips children that cannot contain a closer point
+      if (bnps_knn_prunes(&knn, stack_dist2[top])) {
+        continue;
+      }
+      if (stack_count[top] == 0) {
+        const struct bnps_tree_node* node = nodes + stack_child[top];
+        float dist2[4];
+        bnps__dist4_box(
+          node->minx, node->miny, node->minz,
+          node->maxx, node->maxy, node->maxz,
+          p, dist2);
+        // Orders the children from farthest to nearest (insertion sort)
+        // and pushes them in that order; the nearest is visited first,
+        // which shrinks the worst distance quickly and prunes the others.
+        bnp_size order[4] = { 0, 1, 2, 3 };
+        for (bnp_size i = 1; i < 4; i++) {
+          for (bnp_size j = i; j > 0 && dist2[order[j - 1]] < dist2[order[j]]; j--) {
+            bnp_size swap = order[j];
+            order[j] = order[j - 1];
+            order[j - 1] = swap;
+          }
+        }
+        for (bnp_size i = 0; i < 4; i++) {
+          bnp_size c = order[i];
+          if (node->count[c] == 0 && node->child[c] == 0) continue;
+          if (bnps_knn_prunes(&knn, dist2[c])) continue;
+          #ifdef BNPS_TREE_DEBUG
+            assert(top < BNPS_TREE_STACK_SIZE);
+          #endif
+          stack_child[top] = node->child[c];
+          stack_count[top] = node->count[c];
+          stack_dist2[top] = dist2[c];
+          top++;
+        }
+        continue;
+      }
+      bnp_size i = stack_child[top];
+      bnp_size end = i + stack_count[top];
+      // measures four points at a time
+      for (; i + 4 <= end; i += 4) {
+        float dist2[4];
+        bnps__dist4(xs + i, ys + i, zs + i, p, dist2);
+        for (bnp_size j = 0; j < 4; j++) {
+          bnps_knn_offer(&knn, ids[i + j], dist2[j]);
+        }
+      }
+      // measures the remaining points
+      for (; i < end; i++) {
+        bnps_knn_offer(&knn, ids[i], bnps__point_dist2(xs[i], ys[i], zs[i], p));
+      }
+    }
+    bnps_knn_flush(&knn, results);
+    bnps_knn_free(&knn);
+  }
+#endif
+#endif